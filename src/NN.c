@@ -21,8 +21,12 @@ const char *email = "yuc129@ucsd.edu";
 //------------------------------------//
 
 // Handy Global for use in output routines
-const char *bpName[4] = {"Static", "Gshare",
-                         "Tournament", "Custom"};
+const char *bpName[5] = {"Static", "Gshare",
+                         "Tournament", "Custom", "Hybrid"};
+const char *compName[NUM_COMP_TYPES] = {"gshare", "global",
+                                        "local", "perceptron"};
+const char *chooserName[2] = {"meta", "vote"};
+const int predictorFeatures = 0;
 
 int ghistoryBits; // Number of bits used for Global History
 int lhistoryBits; // Number of bits used for Local History
@@ -30,6 +34,14 @@ int pcIndexBits;  // Number of bits used for PC index
 int bpType;       // Branch Prediction Type
 int verbose;
 
+// HYBRID is not implemented here (see predictorFeatures) and main.c
+// rejects it; the configuration is still declared by predictor.h
+int hybridChooser;
+int numComponents;
+int components[NUM_COMP_TYPES];
+int wLen; // The network has fixed dimensions, these stay unused
+int wH;
+
 //------------------------------------//
 //      Predictor Data Structures     //
 //------------------------------------//
@@ -223,6 +235,48 @@ void init_predictor()
   }
 }
 
+// Exact predictor state in bits for the current configuration. The
+// network's weights are 32-bit floats; activations and deltas are
+// recomputed every branch and not counted.
+//
+uint64_t predictor_bits()
+{
+  switch (bpType)
+  {
+  case GSHARE:
+    return ((uint64_t)1 << ghistoryBits) + ghistoryBits;
+  case TOURNAMENT:
+    return ((uint64_t)4 << ghistoryBits) + ((uint64_t)lhistoryBits << pcIndexBits) +
+           ((uint64_t)2 << lhistoryBits) + ghistoryBits;
+  case CUSTOM:
+    return (uint64_t)32 * ((PCBIT + HIS_LEN) * W_HIDDEN + W_HIDDEN * W_OUT + W_OUT) + HIS_LEN;
+  default:
+    return 0;
+  }
+}
+
+// Release the predictor's tables so another one can be initialized
+//
+void free_predictor()
+{
+  free(globalPredictor);
+  free(localPredictor);
+  free(lhistoryRegs);
+  free(choice);
+  globalPredictor = localPredictor = choice = NULL;
+  lhistoryRegs = NULL;
+  ghistoryReg = 0;
+}
+
+int uses_local_history() { return bpType == TOURNAMENT; }
+int uses_perceptron() { return 0; }
+
+// Snapshots of the network are not supported
+//
+size_t predictor_state_size() { return 0; }
+int save_predictor(FILE *f) { return 0; }
+int load_predictor(FILE *f) { return 0; }
+
 int clip(int reg, int bits)
 {
   return reg & ((1 << bits) - 1);
@@ -0,0 +1,261 @@
+//========================================================//
+//  autotune.c                                            //
+//  Source file for the configuration autotuner           //
+//                                                        //
+//  Every round forks one worker per core; each worker    //
+//  reopens the trace, simulates its share of the         //
+//  candidates and reports through a pipe                 //
+//========================================================//
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "predictor.h"
+#include "trace.h"
+#include "autotune.h"
+
+#define MAX_BITS 30 // Largest table index tried
+
+typedef struct
+{
+  int ghistoryBits;
+  int lhistoryBits;
+  int pcIndexBits;
+  int wLen;
+  int wH;
+  uint32_t branches;       // Branches simulated in the last round
+  uint32_t mispredictions;
+} Candidate;
+
+typedef struct
+{
+  int candidate;
+  uint32_t branches;
+  uint32_t mispredictions;
+} Result;
+
+Candidate *candidates;
+int numCandidates;
+int capacity;
+
+void use_candidate(const Candidate *c)
+{
+  ghistoryBits = c->ghistoryBits;
+  lhistoryBits = c->lhistoryBits;
+  pcIndexBits = c->pcIndexBits;
+  wLen = c->wLen;
+  wH = c->wH;
+}
+
+// Add the current configuration if it fits in 'bits'; perceptron rows
+// are first grown to fill what the other tables leave
+//
+void add_candidate(uint64_t bits)
+{
+  wLen = 1;
+  uint64_t base = predictor_bits();
+  wLen = 2;
+  uint64_t row = predictor_bits() - base;
+  wLen = 1;
+  if (base > bits)
+    return;
+  if (row)
+    wLen += (bits - base) / row < MAX_ROWS ? (bits - base) / row : MAX_ROWS - 1;
+
+  // Configurations using less than half the budget are dominated
+  if (predictor_bits() * 2 <= bits && bpType != GSHARE && bpType != STATIC)
+    return;
+
+  if (numCandidates == capacity)
+  {
+    capacity = capacity ? 2 * capacity : 64;
+    candidates = realloc(candidates, capacity * sizeof *candidates);
+  }
+  Candidate c = {ghistoryBits, lhistoryBits, pcIndexBits, wLen, wH, 0, 0};
+  candidates[numCandidates++] = c;
+}
+
+// Order candidates by configuration, to find duplicates
+//
+int compare_configs(const void *a, const void *b)
+{
+  const Candidate *x = a, *y = b;
+  if (x->ghistoryBits != y->ghistoryBits)
+    return x->ghistoryBits - y->ghistoryBits;
+  if (x->lhistoryBits != y->lhistoryBits)
+    return x->lhistoryBits - y->lhistoryBits;
+  if (x->pcIndexBits != y->pcIndexBits)
+    return x->pcIndexBits - y->pcIndexBits;
+  if (x->wLen != y->wLen)
+    return x->wLen - y->wLen;
+  return x->wH - y->wH;
+}
+
+// Enumerate only the sizes the scheme has tables for; the others keep
+// their command line values
+//
+void generate_candidates(uint64_t bits)
+{
+  int local = uses_local_history();
+  int lfirst = local ? 1 : lhistoryBits, llast = local ? MAX_BITS : lhistoryBits;
+  int pfirst = local ? 1 : pcIndexBits, plast = local ? MAX_BITS : pcIndexBits;
+
+  numCandidates = 0;
+  switch (bpType)
+  {
+  case GSHARE:
+    for (ghistoryBits = 1; ghistoryBits <= MAX_BITS; ghistoryBits++)
+      add_candidate(bits);
+    break;
+  case TOURNAMENT:
+  case HYBRID:
+    for (ghistoryBits = 1; ghistoryBits <= MAX_BITS; ghistoryBits++)
+      for (lhistoryBits = lfirst; lhistoryBits <= llast; lhistoryBits++)
+        for (pcIndexBits = pfirst; pcIndexBits <= plast; pcIndexBits++)
+          add_candidate(bits);
+    break;
+  case CUSTOM:
+    // One history bit per weight after the bias
+    for (wH = 2; wH <= 33; wH++)
+      add_candidate(bits);
+    break;
+  default:
+    add_candidate(bits);
+    break;
+  }
+
+  // Identical candidates would only split the rounds between copies
+  qsort(candidates, numCandidates, sizeof *candidates, compare_configs);
+  int unique = 0;
+  for (int i = 0; i < numCandidates; i++)
+    if (unique == 0 || compare_configs(&candidates[unique - 1], &candidates[i]))
+      candidates[unique++] = candidates[i];
+  numCandidates = unique;
+}
+
+// Worker 'w' of 'workers': simulate every candidate it owns on the
+// first 'prefix' branches and write the results to 'fd'
+//
+void evaluate(int w, int workers, int n, uint32_t prefix, int fd)
+{
+  uint32_t pc;
+  uint8_t outcome;
+
+  // A private stream, the parent's shares its file offset with us
+  if (!open_trace(traceName))
+    _exit(1);
+
+  for (int i = w; i < n; i += workers)
+  {
+    Result r = {i, 0, 0};
+    use_candidate(&candidates[i]);
+    init_predictor();
+    seek_offset(0, 0);
+    while (r.branches < prefix && read_branch(&pc, &outcome))
+    {
+      if (make_prediction(pc) != outcome)
+        r.mispredictions++;
+      train_predictor(pc, outcome);
+      r.branches++;
+    }
+    free_predictor();
+    if (write(fd, &r, sizeof r) != sizeof r)
+      _exit(1);
+  }
+  _exit(0);
+}
+
+// Run the first 'n' candidates on 'prefix' branches across all cores
+//
+// Returns True if Successful
+//
+int run_round(int n, uint32_t prefix)
+{
+  int fd[2];
+  int workers = sysconf(_SC_NPROCESSORS_ONLN);
+  int received = 0;
+  Result r;
+
+  if (workers < 1)
+    workers = 1;
+  if (workers > n)
+    workers = n;
+  if (pipe(fd) != 0)
+    return 0;
+
+  // Buffered output would otherwise be written again by every worker
+  fflush(stdout);
+  for (int w = 0; w < workers; w++)
+  {
+    pid_t pid = fork();
+    if (pid < 0)
+      return 0;
+    if (pid == 0)
+    {
+      close(fd[0]);
+      evaluate(w, workers, n, prefix, fd[1]);
+    }
+  }
+  close(fd[1]);
+
+  while (read(fd[0], &r, sizeof r) == sizeof r)
+  {
+    candidates[r.candidate].branches = r.branches;
+    candidates[r.candidate].mispredictions = r.mispredictions;
+    received++;
+  }
+  close(fd[0]);
+
+  int ok = received == n;
+  for (int w = 0; w < workers; w++)
+  {
+    int status;
+    wait(&status);
+    ok &= WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  }
+  return ok;
+}
+
+int compare_candidates(const void *a, const void *b)
+{
+  const Candidate *x = a, *y = b;
+  // Fewer mispredictions per branch first; all ran the same prefix
+  uint64_t mx = (uint64_t)x->mispredictions * y->branches;
+  uint64_t my = (uint64_t)y->mispredictions * x->branches;
+  return mx < my ? -1 : mx > my;
+}
+
+int autotune(uint64_t bits, uint32_t prefix)
+{
+  if (trace_offset() < 0 || prefix == 0)
+    return 0;
+
+  generate_candidates(bits);
+  if (numCandidates == 0)
+    return 0;
+
+  int n = numCandidates;
+  for (int round = 1; n > 1; round++)
+  {
+    if (!run_round(n, prefix))
+      return 0;
+    qsort(candidates, n, sizeof *candidates, compare_candidates);
+    fprintf(stderr, "Round %d: %d candidates on %u branches, best %.3f\n", round, n,
+            candidates[0].branches,
+            100 * (float)candidates[0].mispredictions / candidates[0].branches);
+
+    // Once the prefix covers the whole trace there is nothing left to learn
+    if (candidates[0].branches < prefix)
+      n = 1;
+    n = (n + 1) / 2;
+    prefix = prefix > UINT32_MAX / 2 ? UINT32_MAX : 2 * prefix;
+  }
+
+  use_candidate(&candidates[0]);
+  free(candidates);
+  candidates = NULL;
+  capacity = 0;
+  return 1;
+}
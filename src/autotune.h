@@ -0,0 +1,26 @@
+//========================================================//
+//  autotune.h                                            //
+//  Header file for the configuration autotuner           //
+//                                                        //
+//  Searches the table and history sizes of the selected  //
+//  scheme for the most accurate configuration within a   //
+//  storage budget                                        //
+//========================================================//
+
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include <stdint.h>
+
+// Successive halving over every configuration of the selected scheme
+// that fits in 'bits': all candidates are run on the first 'prefix'
+// branches of the open trace, the better half is kept and run on twice
+// as many branches, and so on until one is left. Candidates are
+// evaluated in parallel by one process per core.
+//
+// Leaves the winning configuration in the predictor configuration
+// variables and returns True if Successful
+//
+int autotune(uint64_t bits, uint32_t prefix);
+
+#endif
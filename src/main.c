@@ -9,10 +9,22 @@
 #include <stdlib.h>
 #include <string.h>
 #include "predictor.h"
+#include "trace.h"
+#include "sample.h"
+#include "autotune.h"
 
-FILE *stream;
-char *buf = NULL;
-size_t len = 0;
+double budget = 0;  // Storage budget in Kbits, 0 for none
+int scale = 0;      // Scale table sizes to fill the budget
+uint32_t autotunePrefix = 0; // Autotune starting from prefixes this long
+
+uint32_t indexInterval = 0; // Write a trace index with this interval
+int indexSnapshots = 0;     // Include predictor snapshots in the index
+uint32_t skip = 0;          // First branch simulated
+uint32_t count = UINT32_MAX; // Maximum number of branches simulated
+int warm = 0;               // Train on the branches before 'skip'
+uint32_t sampleInterval = 0; // Sample intervals of this many branches
+int sampleClusters = 0;     // Number of phases to sample from
+int sampleWarmup = 1;       // Warm-up intervals before each sample
 
 // Print out the Usage information to stderr
 //
@@ -28,7 +40,82 @@ usage()
   fprintf(stderr,"    static\n"
                  "    gshare:<# ghistory>\n"
                  "    tournament:<# ghistory>:<# lhistory>:<# index>\n"
-                 "    custom\n");
+                 "    custom[:<# rows>:<# weights>]\n"
+                 "    hybrid:<chooser>:<comp>[,<comp>...]:<# ghistory>:<# lhistory>:<# index>\n"
+                 "      chooser: meta | vote\n"
+                 "      comp:    gshare | global | local | perceptron\n");
+  fprintf(stderr," --budget:<Kbits> Reject configurations larger than the budget\n");
+  fprintf(stderr," --scale      Grow or shrink the tables to fill the budget\n");
+  fprintf(stderr," --autotune[:<prefix>]\n"
+                 "              Search for the best sizes within the budget,\n"
+                 "              first on <prefix> branches (default 100000)\n");
+  fprintf(stderr," --index:<N>[:snapshot]\n"
+                 "              Write <trace>.idx with an entry every N branches\n");
+  fprintf(stderr," --skip:<N>   Start simulating at branch N\n");
+  fprintf(stderr," --count:<N>  Simulate at most N branches\n");
+  fprintf(stderr," --warm       Train on the skipped branches\n");
+  fprintf(stderr," --roi:<start>:<count>\n"
+                 "              Same as --skip:<start> --count:<count> --warm\n");
+  fprintf(stderr," --sample:<interval>:<phases>[:<warm-up intervals>]\n"
+                 "              Estimate the rate from a few intervals per phase\n");
+}
+
+// Returns True if 'bits' is a usable table index width
+//
+int
+valid_bits(int bits)
+{
+  return bits >= 1 && bits <= 30;
+}
+
+// Parse the chooser and component list of a hybrid predictor
+//
+// Returns True if Successful
+//
+int
+handle_hybrid(char *spec)
+{
+  char chooser[8], list[64];
+  if (sscanf(spec,"%7[a-z]:%63[a-z,]:%d:%d:%d", chooser, list,
+             &ghistoryBits, &lhistoryBits, &pcIndexBits) != 5) {
+    return 0;
+  }
+  if (!valid_bits(ghistoryBits) || !valid_bits(lhistoryBits) || !valid_bits(pcIndexBits)) {
+    fprintf(stderr,"Hybrid history and index widths must be 1 to 30 bits\n");
+    return 0;
+  }
+
+  hybridChooser = -1;
+  for (int i = 0; i < 2; ++i) {
+    if (!strcmp(chooser, chooserName[i])) {
+      hybridChooser = i;
+    }
+  }
+  if (hybridChooser < 0) {
+    return 0;
+  }
+
+  numComponents = 0;
+  for (char *name = strtok(list, ","); name; name = strtok(NULL, ",")) {
+    int type = -1;
+    for (int i = 0; i < NUM_COMP_TYPES; ++i) {
+      if (!strcmp(name, compName[i])) {
+        type = i;
+      }
+    }
+    // Each component type owns one set of tables, so it may appear once
+    for (int i = 0; i < numComponents; ++i) {
+      if (components[i] == type) {
+        type = -1;
+      }
+    }
+    if (type < 0) {
+      return 0;
+    }
+    components[numComponents++] = type;
+  }
+
+  return numComponents > 0;
 }
 
 // Process an option and update the predictor
@@ -49,6 +136,54 @@ handle_option(char *arg)
     sscanf(arg+13,"%d:%d:%d", &ghistoryBits, &lhistoryBits, &pcIndexBits);
   } else if (!strcmp(arg,"--custom")) {
     bpType = CUSTOM;
+  } else if (!strncmp(arg,"--custom:",9)) {
+    if (!(predictorFeatures & HAS_PERCEPTRON_SIZE)) {
+      fprintf(stderr,"This predictor's custom scheme has a fixed size\n");
+      return 0;
+    }
+    bpType = CUSTOM;
+    // Weights read one history bit each, plus the bias
+    if (sscanf(arg+9,"%d:%d", &wLen, &wH) != 2 ||
+        wLen < 1 || wLen > MAX_ROWS || wH < 1 || wH > 33) {
+      fprintf(stderr,"Custom needs 1 to %d rows of 1 to 33 weights\n", MAX_ROWS);
+      return 0;
+    }
+  } else if (!strncmp(arg,"--hybrid:",9)) {
+    if (!(predictorFeatures & HAS_HYBRID)) {
+      fprintf(stderr,"This predictor does not implement --hybrid\n");
+      return 0;
+    }
+    bpType = HYBRID;
+    return handle_hybrid(arg+9);
+  } else if (!strncmp(arg,"--budget:",9)) {
+    return sscanf(arg+9,"%lf", &budget) == 1 && budget > 0;
+  } else if (!strcmp(arg,"--scale")) {
+    scale = 1;
+  } else if (!strcmp(arg,"--autotune")) {
+    autotunePrefix = 100000;
+  } else if (!strncmp(arg,"--autotune:",11)) {
+    return sscanf(arg+11,"%u", &autotunePrefix) == 1 && autotunePrefix > 0;
+  } else if (!strncmp(arg,"--index:",8)) {
+    char snapshot[16] = "";
+    if (sscanf(arg+8,"%u:%15s", &indexInterval, snapshot) < 1 || indexInterval == 0) {
+      return 0;
+    }
+    if (snapshot[0] && strcmp(snapshot,"snapshot")) {
+      return 0;
+    }
+    indexSnapshots = snapshot[0] != 0;
+  } else if (!strncmp(arg,"--skip:",7)) {
+    return sscanf(arg+7,"%u", &skip) == 1;
+  } else if (!strncmp(arg,"--count:",8)) {
+    return sscanf(arg+8,"%u", &count) == 1;
+  } else if (!strcmp(arg,"--warm")) {
+    warm = 1;
+  } else if (!strncmp(arg,"--roi:",6)) {
+    warm = 1;
+    return sscanf(arg+6,"%u:%u", &skip, &count) == 2;
+  } else if (!strncmp(arg,"--sample:",9)) {
+    return sscanf(arg+9,"%u:%d:%d", &sampleInterval, &sampleClusters, &sampleWarmup) >= 2 &&
+           sampleInterval > 0 && sampleClusters > 0 && sampleWarmup >= 0;
   } else if (!strcmp(arg,"--verbose")) {
     verbose = 1;
   } else {
@@ -58,30 +193,161 @@ handle_option(char *arg)
   return 1;
 }
 
-// Reads a line from the input stream and extracts the
-// PC and Outcome of a branch
+// Returns True if the scheme has a table indexed by global history
 //
-// Returns True if Successful 
+int
+uses_global_history()
+{
+  return bpType == GSHARE || bpType == TOURNAMENT || bpType == HYBRID;
+}
+
+// Perceptron rows 'k' factors of two away from 'rows', 0 if too
+// small or too large
+//
+int
+scale_rows(int rows, int k)
+{
+  if (k < 0) {
+    return rows >> -k;
+  }
+  return k < 24 && rows <= MAX_ROWS >> k ? rows << k : 0;
+}
+
+// Set every table size the scheme uses 'k' steps (each a factor of
+// two) away from the one given on the command line
+//
+void
+apply_scale(int base[4], int k)
+{
+  ghistoryBits = uses_global_history() ? base[0] + k : base[0];
+  lhistoryBits = uses_local_history() ? base[1] + k : base[1];
+  pcIndexBits = uses_local_history() ? base[2] + k : base[2];
+  wLen = uses_perceptron() ? scale_rows(base[3], k) : base[3];
+}
+
+// Returns True if configuration 'k' is valid for the scheme
 //
 int
-read_branch(uint32_t *pc, uint8_t *outcome)
+scale_valid(int base[4], int k)
 {
-  if (getline(&buf, &len, stream) == -1) {
+  if (uses_perceptron() && scale_rows(base[3], k) < 1) {
     return 0;
   }
+  if (uses_global_history() && !valid_bits(base[0] + k)) {
+    return 0;
+  }
+  if (uses_local_history() && (!valid_bits(base[1] + k) || !valid_bits(base[2] + k))) {
+    return 0;
+  }
+  return k == 0 || uses_global_history() || uses_local_history() || uses_perceptron();
+}
 
-  uint32_t tmp;
-  sscanf(buf,"0x%x %d\n",pc,&tmp);
-  *outcome = tmp;
+// Scale all table sizes together to the largest configuration that
+// fits in 'bits', then grow single tables and finally fill what is
+// left with perceptron rows
+//
+void
+scale_to_budget(uint64_t bits)
+{
+  int base[4] = {ghistoryBits, lhistoryBits, pcIndexBits, wLen};
+  int k = 0;
+  uint64_t size = predictor_bits();
 
-  return 1;
+  // Grow while the next step still fits, shrink until this one does
+  while (scale_valid(base, k + 1)) {
+    apply_scale(base, k + 1);
+    if (predictor_bits() > bits || predictor_bits() <= size) {
+      break;
+    }
+    size = predictor_bits();
+    k++;
+  }
+  while (size > bits && scale_valid(base, k - 1)) {
+    apply_scale(base, k - 1);
+    if (predictor_bits() >= size) {
+      break;
+    }
+    size = predictor_bits();
+    k--;
+  }
+  apply_scale(base, k);
+
+  // Doubling every table at once can leave half the budget unused, so
+  // keep doubling the one table whose growth still fits and adds most
+  int *dims[3] = {&ghistoryBits, &lhistoryBits, &pcIndexBits};
+  int used[3] = {uses_global_history(), uses_local_history(), uses_local_history()};
+  for (int best = 0; best >= 0 && size <= bits; ) {
+    uint64_t grown = size;
+    best = -1;
+    for (int d = 0; d < 3; ++d) {
+      if (!used[d] || !valid_bits(*dims[d] + 1)) {
+        continue;
+      }
+      ++*dims[d];
+      if (predictor_bits() <= bits && predictor_bits() > grown) {
+        grown = predictor_bits();
+        best = d;
+      }
+      --*dims[d];
+    }
+    if (best >= 0) {
+      ++*dims[best];
+      size = grown;
+    }
+  }
+
+  // Perceptron rows need not be a power of two
+  while (uses_perceptron() && size <= bits && wLen < MAX_ROWS) {
+    wLen++;
+    if (predictor_bits() > bits || predictor_bits() <= size) {
+      wLen--;
+      break;
+    }
+    size = predictor_bits();
+  }
+}
+
+// Write the configuration being simulated in command line form
+//
+void
+format_config(char *out, size_t size)
+{
+  int n = 0;
+  switch (bpType) {
+    case STATIC:
+      snprintf(out, size, "static");
+      break;
+    case GSHARE:
+      snprintf(out, size, "gshare:%d", ghistoryBits);
+      break;
+    case TOURNAMENT:
+      snprintf(out, size, "tournament:%d:%d:%d", ghistoryBits, lhistoryBits, pcIndexBits);
+      break;
+    case CUSTOM:
+      if (predictorFeatures & HAS_PERCEPTRON_SIZE) {
+        snprintf(out, size, "custom:%d:%d", wLen, wH);
+      } else {
+        snprintf(out, size, "custom");
+      }
+      break;
+    case HYBRID:
+      n = snprintf(out, size, "hybrid:%s:", chooserName[hybridChooser]);
+      for (int c = 0; c < numComponents; ++c) {
+        n += snprintf(out + n, size - n, "%s%s", c ? "," : "", compName[components[c]]);
+      }
+      n += snprintf(out + n, size - n, ":%d:%d:%d", ghistoryBits, lhistoryBits, pcIndexBits);
+      if (uses_perceptron()) {
+        snprintf(out + n, size - n, " custom:%d:%d", wLen, wH);
+      }
+      break;
+  }
 }
 
 int
 main(int argc, char *argv[])
 {
   // Set defaults
-  stream = stdin;
+  const char *trace = NULL;
   bpType = STATIC;
   verbose = 0;
 
@@ -98,12 +364,76 @@ main(int argc, char *argv[])
       }
     } else {
       // Use as input file
-      stream = fopen(argv[i], "r");
+      trace = argv[i];
+    }
+  }
+
+  if (!open_trace(trace)) {
+    fprintf(stderr,"Cannot open trace %s\n", trace);
+    exit(1);
+  }
+  if (indexInterval && (skip || count != UINT32_MAX)) {
+    fprintf(stderr,"An index is built from the whole trace, without --skip/--count/--roi\n");
+    exit(1);
+  }
+  if ((scale || autotunePrefix) && bpType == CUSTOM &&
+      !(predictorFeatures & HAS_PERCEPTRON_SIZE)) {
+    fprintf(stderr,"This predictor's custom scheme has a fixed size, it cannot be scaled or tuned\n");
+    exit(1);
+  }
+  if (autotunePrefix && budget <= 0) {
+    fprintf(stderr,"--autotune needs a --budget\n");
+    exit(1);
+  }
+  if (sampleInterval && (indexInterval || skip || count != UINT32_MAX || verbose)) {
+    fprintf(stderr,"--sample chooses its own branches, without --index/--skip/--count/--roi/--verbose\n");
+    exit(1);
+  }
+
+  // Check the configuration against the storage budget
+  char config[128];
+  if (budget > 0) {
+    uint64_t bits = budget * 1024;
+    if (autotunePrefix) {
+      if (!autotune(bits, autotunePrefix)) {
+        fprintf(stderr,"Cannot autotune, the trace must be a file and a configuration must fit\n");
+        exit(1);
+      }
+    } else if (scale) {
+      scale_to_budget(bits);
+    }
+    if (autotunePrefix || scale) {
+      format_config(config, sizeof config);
+      printf("Configuration:   %s\n", config);
+    }
+    if (predictor_bits() > bits) {
+      fprintf(stderr,"Predictor needs %.3f Kbits, over the %.3f Kbits budget\n",
+              predictor_bits() / 1024.0, budget);
+      exit(1);
     }
   }
 
   // Initialize the predictor
   init_predictor();
+  format_config(config, sizeof config);
+
+  if (indexInterval && !begin_index(indexInterval, indexSnapshots, config)) {
+    fprintf(stderr,"Cannot index %s, the trace must be a file\n", trace ? trace : "stdin");
+    exit(1);
+  }
+
+  if (sampleInterval) {
+    if (!sample_trace(sampleInterval, sampleClusters, sampleWarmup, config)) {
+      fprintf(stderr,"Cannot sample %s, the trace must be a non-empty file\n", trace ? trace : "stdin");
+      exit(1);
+    }
+    free_predictor();
+    close_trace();
+    return 0;
+  }
+
+  // Move to the region of interest
+  seek_branch(skip, warm, config);
 
   uint32_t num_branches = 0;
   uint32_t mispredictions = 0;
@@ -111,7 +441,7 @@ main(int argc, char *argv[])
   uint8_t outcome = NOTTAKEN;
 
   // Reach each branch from the trace
-  while (read_branch(&pc, &outcome)) {
+  while (num_branches < count && read_branch(&pc, &outcome)) {
     num_branches++;
 
     // Make a prediction and compare with actual outcome
@@ -128,14 +458,16 @@ main(int argc, char *argv[])
   }
 
   // Print out the mispredict statistics
+  printf("Storage (bits):  %10llu (%.3f Kbits)\n",
+         (unsigned long long)predictor_bits(), predictor_bits() / 1024.0);
   printf("Branches:        %10d\n", num_branches);
   printf("Incorrect:       %10d\n", mispredictions);
   float mispredict_rate = 100*((float)mispredictions / (float)num_branches);
   printf("Misprediction Rate: %7.3f\n", mispredict_rate);
 
   // Cleanup
-  fclose(stream);
-  free(buf);
+  free_predictor();
+  close_trace();
 
   return 0;
 }
@@ -5,7 +5,10 @@
 //  Implement the various branch predictors below as      //
 //  described in the README                               //
 //========================================================//
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
 #include "predictor.h"
 
 //
@@ -19,55 +22,98 @@ const char *email = "yuc129@ucsd.edu";
 //      Predictor Configuration       //
 //------------------------------------//
 
+#define W_LEN 251
+#define W_H 32
+
 // Handy Global for use in output routines
-const char *bpName[4] = {"Static", "Gshare",
-                         "Tournament", "Custom"};
+const char *bpName[5] = {"Static", "Gshare",
+                         "Tournament", "Custom", "Hybrid"};
+const char *compName[NUM_COMP_TYPES] = {"gshare", "global",
+                                        "local", "perceptron"};
+const char *chooserName[2] = {"meta", "vote"};
+const int predictorFeatures = HAS_HYBRID | HAS_PERCEPTRON_SIZE;
 
 int ghistoryBits; // Number of bits used for Global History
 int lhistoryBits; // Number of bits used for Local History
 int pcIndexBits;  // Number of bits used for PC index
 int bpType;       // Branch Prediction Type
 int verbose;
+int wLen = W_LEN; // Rows of perceptron weights
+int wH = W_H;     // Weights per row (bias + global history bits)
+
+int hybridChooser;                 // HYBRID chooser (META or VOTE)
+int numComponents;                 // Number of HYBRID components
+int components[NUM_COMP_TYPES];    // HYBRID component types, in order
 
 //------------------------------------//
 //      Predictor Data Structures     //
 //------------------------------------//
 
+// Every table of the predictor is carved from one arena mapping,
+// cache-line aligned and backed by huge pages where the system has them
+#define CACHE_LINE 64
+#define HUGE_PAGE (2 << 20)
+
+char *arena;
+size_t arenaSize;
+size_t arenaUsed;
+
+// The tournament global counter and choice counter of one global
+// history sit side by side so a lookup touches a single cache line
+typedef struct
+{
+  uint8_t global;
+  uint8_t choice;
+} tentry;
+
 uint32_t ghistoryReg = 0;
 uint8_t *globalPredictor;
 uint8_t *localPredictor;
 uint32_t *lhistoryRegs;
-uint8_t *choice;
+tentry *tournament;
 uint8_t lpred;
 uint8_t gpred;
 
-#define W_LEN 251
-#define W_H 32
 #define MAX_WEIGHT 1 << 7
 
-int8_t W[W_LEN][W_H];     // 8*251*32 = 62.75Kbits
-int8_t ghistory[W_H - 1]; // 31*8 = 0.24Kbits
+int8_t *W;                // wLen rows of wH weights, 8*251*32 = 62.75Kbits by default
 
 int threshold;
 uint8_t _hot = -1;
 uint8_t train = 0;
 
+// Hybrid state. All components read the same (unclipped) ghistoryReg and
+// each one's table index is computed once in make_prediction and reused
+// by train_predictor.
+uint8_t *gsharePredictor;
+uint8_t *metaTable;  // META: numComponents 2-bit counters per row
+int8_t *voteWeights; // VOTE: bias + numComponents weights per row
+int voteThreshold;
+uint32_t metaIndex;
+uint32_t compIndex[NUM_COMP_TYPES];
+uint8_t compPred[NUM_COMP_TYPES];
+int voteOut;
+
 //------------------------------------//
 //        Predictor Functions         //
 //------------------------------------//
 
 // Initialize the predictor
 //
-int hash(uint32_t pc) { return (pc * 3) % W_LEN; }
+// Drop the byte offset so that any number of rows spreads the PCs evenly
+int hash(uint32_t pc) { return (pc >> 2) % wLen; }
 
 void backward(int8_t *w, uint8_t same) { *w += same == 1 ? (*w < MAX_WEIGHT - 1 ? 1 : 0) : (*w > -MAX_WEIGHT ? -1 : 0); }
+// History bit i as a perceptron input: +1 taken, -1 not taken
+int hbit(int i) { return (ghistoryReg >> i) & 1 ? 1 : -1; }
+
 int forward(uint32_t pc)
 {
-  int index = hash(pc);
-  int out = W[index][0];
+  int8_t *w = &W[hash(pc) * wH];
+  int out = w[0];
 
-  for (int i = 1; i < W_H; i++)
-    out += ghistory[i - 1] * W[index][i];
+  for (int i = 1; i < wH; i++)
+    out += hbit(i - 1) * w[i];
 
   _hot = (out >= 0) ? TAKEN : NOTTAKEN;
   train = (out < threshold && out > -threshold) ? 1 : 0;
@@ -75,45 +121,253 @@ int forward(uint32_t pc)
   return _hot;
 }
 
+void perceptron_train(int index, uint8_t outcome)
+{
+  int8_t pout = outcome == TAKEN ? 1 : -1;
+  int8_t *w = &W[index * wH];
+
+  if ((_hot != outcome) || train)
+  {
+    backward(&w[0], pout);
+    for (int i = 1; i < wH; i++)
+      backward(&w[i], (pout == hbit(i - 1)));
+  }
+}
+
+void init_perceptron()
+{
+  threshold = 1.25 * wH + 14;
+}
+
+// Entries of a table indexed by 'bits' bits
+//
+size_t entries(int bits) { return (size_t)1 << bits; }
+
+// Carve 'size' bytes from the arena at the next cache line. Before the
+// arena is mapped this only measures the layout.
+//
+void *arena_alloc(size_t size)
+{
+  size_t offset = (arenaUsed + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1);
+  arenaUsed = offset + size;
+  return arena ? arena + offset : NULL;
+}
+
+// Point every table of the configured scheme into the arena
+//
+void layout_tables()
+{
+  arenaUsed = 0;
+  switch (bpType)
+  {
+  case GSHARE:
+    globalPredictor = arena_alloc(entries(ghistoryBits) * sizeof *globalPredictor);
+    break;
+  case TOURNAMENT:
+    tournament = arena_alloc(entries(ghistoryBits) * sizeof *tournament);
+    lhistoryRegs = arena_alloc(entries(pcIndexBits) * sizeof *lhistoryRegs);
+    localPredictor = arena_alloc(entries(lhistoryBits) * sizeof *localPredictor);
+    break;
+  case CUSTOM:
+    W = arena_alloc((size_t)wLen * wH * sizeof *W);
+    break;
+  case HYBRID:
+    for (int c = 0; c < numComponents; c++)
+    {
+      switch (components[c])
+      {
+      case COMP_GSHARE:
+        gsharePredictor = arena_alloc(entries(ghistoryBits) * sizeof *gsharePredictor);
+        break;
+      case COMP_GLOBAL:
+        globalPredictor = arena_alloc(entries(ghistoryBits) * sizeof *globalPredictor);
+        break;
+      case COMP_LOCAL:
+        lhistoryRegs = arena_alloc(entries(pcIndexBits) * sizeof *lhistoryRegs);
+        localPredictor = arena_alloc(entries(lhistoryBits) * sizeof *localPredictor);
+        break;
+      case COMP_PERCEPTRON:
+        W = arena_alloc((size_t)wLen * wH * sizeof *W);
+        break;
+      }
+    }
+    if (hybridChooser == META)
+      metaTable = arena_alloc(entries(ghistoryBits) * numComponents * sizeof *metaTable);
+    else
+      voteWeights = arena_alloc(entries(ghistoryBits) * (numComponents + 1) * sizeof *voteWeights);
+    break;
+  }
+}
+
+// Map a zeroed arena large enough for the configured scheme and lay
+// the tables out in it
+//
+void arena_map()
+{
+  arena = NULL;
+  layout_tables();
+  if (arenaUsed == 0)
+    return;
+
+  arenaSize = arenaUsed;
+  if (arenaSize >= HUGE_PAGE)
+  {
+    arenaSize = (arenaSize + HUGE_PAGE - 1) & ~(size_t)(HUGE_PAGE - 1);
+#ifdef MAP_HUGETLB
+    // Explicit huge pages, only available if the admin reserved some
+    arena = mmap(NULL, arenaSize, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (arena == MAP_FAILED)
+      arena = NULL;
+#endif
+  }
+  if (!arena)
+  {
+    arena = mmap(NULL, arenaSize, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (arena == MAP_FAILED)
+    {
+      fprintf(stderr, "Cannot map %zu bytes for the predictor tables\n", arenaSize);
+      exit(1);
+    }
+#ifdef MADV_HUGEPAGE
+    // Otherwise ask for transparent huge pages
+    if (arenaSize >= HUGE_PAGE)
+      madvise(arena, arenaSize, MADV_HUGEPAGE);
+#endif
+  }
+  layout_tables();
+}
+
+int uses_component(int type)
+{
+  for (int c = 0; bpType == HYBRID && c < numComponents; c++)
+    if (components[c] == type)
+      return 1;
+  return 0;
+}
+
+int uses_local_history() { return bpType == TOURNAMENT || uses_component(COMP_LOCAL); }
+int uses_perceptron() { return bpType == CUSTOM || uses_component(COMP_PERCEPTRON); }
+
+// Exact predictor state in bits for the current configuration
+//
+uint64_t counter_bits(int bits) { return (uint64_t)2 << bits; }
+uint64_t perceptron_bits() { return (uint64_t)8 * wLen * wH; }
+
+uint64_t predictor_bits()
+{
+  uint64_t bits = 0;
+  int history = ghistoryBits;
+
+  switch (bpType)
+  {
+  case GSHARE:
+    return counter_bits(ghistoryBits) + ghistoryBits;
+  case TOURNAMENT:
+    return 2 * counter_bits(ghistoryBits) + ((uint64_t)lhistoryBits << pcIndexBits) +
+           counter_bits(lhistoryBits) + ghistoryBits;
+  case CUSTOM:
+    return perceptron_bits() + wH - 1;
+  case HYBRID:
+    for (int c = 0; c < numComponents; c++)
+    {
+      switch (components[c])
+      {
+      case COMP_GSHARE:
+      case COMP_GLOBAL:
+        bits += counter_bits(ghistoryBits);
+        break;
+      case COMP_LOCAL:
+        bits += ((uint64_t)lhistoryBits << pcIndexBits) + counter_bits(lhistoryBits);
+        break;
+      case COMP_PERCEPTRON:
+        bits += perceptron_bits();
+        if (wH - 1 > history)
+          history = wH - 1;
+        break;
+      }
+    }
+    if (hybridChooser == META)
+      bits += numComponents * counter_bits(ghistoryBits);
+    else
+      bits += ((uint64_t)8 * (numComponents + 1)) << ghistoryBits;
+    return bits + history;
+  default:
+    return 0;
+  }
+}
+
+uint8_t counter_predict(uint8_t counter) { return counter >= WT ? TAKEN : NOTTAKEN; }
+
+void counter_update(uint8_t *counter, uint8_t outcome)
+{
+  if (outcome == TAKEN && *counter < ST)
+    *counter += 1;
+  if (outcome == NOTTAKEN && *counter > SN)
+    *counter -= 1;
+}
+
+// The arena comes zeroed, so only non-zero initial state is written
+//
+void init_hybrid()
+{
+  ghistoryReg = 0;
+  for (int c = 0; c < numComponents; c++)
+  {
+    switch (components[c])
+    {
+    case COMP_GSHARE:
+      memset(gsharePredictor, WN, entries(ghistoryBits));
+      break;
+    case COMP_GLOBAL:
+      memset(globalPredictor, WN, entries(ghistoryBits));
+      break;
+    case COMP_LOCAL:
+      memset(localPredictor, WN, entries(lhistoryBits));
+      break;
+    case COMP_PERCEPTRON:
+      init_perceptron();
+      break;
+    }
+  }
+
+  if (hybridChooser == META)
+    memset(metaTable, WN, entries(ghistoryBits) * numComponents);
+  else
+    voteThreshold = 1.93 * numComponents + 14;
+}
+
 void init_predictor()
 {
   //
   // TODO: Initialize Branch Predictor Data Structures
   //
+  arena_map();
   switch (bpType)
   {
   case STATIC:
     break;
   case GSHARE:
     ghistoryReg = 0;
-    globalPredictor = malloc((1 << ghistoryBits) * sizeof *globalPredictor);
-    for (int i = 0; i < (1 << ghistoryBits); i++)
-      globalPredictor[i] = 1;
+    memset(globalPredictor, WN, entries(ghistoryBits));
     break;
   case TOURNAMENT:
     ghistoryReg = 0;
-    globalPredictor = malloc((1 << ghistoryBits) * sizeof *globalPredictor);
-    for (int i = 0; i < (1 << ghistoryBits); i++)
-      globalPredictor[i] = 1;
-    choice = malloc((1 << ghistoryBits) * sizeof *choice);
     for (int i = 0; i < (1 << ghistoryBits); i++)
-      choice[i] = 1;
-
-    lhistoryRegs = malloc((1 << pcIndexBits) * sizeof lhistoryRegs);
-    for (int i = 0; i < (1 << pcIndexBits); i++)
-      lhistoryRegs[i] = 0;
-    localPredictor = malloc((1 << lhistoryBits) * sizeof localPredictor);
-    for (int i = 0; i < (1 << lhistoryBits); i++)
-      localPredictor[i] = 1;
-
+    {
+      tournament[i].global = WN;
+      tournament[i].choice = WN;
+    }
+    memset(localPredictor, WN, entries(lhistoryBits));
     break;
   case CUSTOM:
-    threshold = 1.25 * W_H + 14;
-    for (int i = 0; i < W_LEN; i++)
-      for (int j = 0; j < W_H; j++)
-        W[i][j] = 0;
-    for (int i = 0; i < W_H; i++)
-      ghistory[i] = -1;
+    ghistoryReg = 0;
+    init_perceptron();
+    break;
+  case HYBRID:
+    init_hybrid();
+    break;
   default:
     break;
   }
@@ -124,6 +378,131 @@ uint32_t clip(uint32_t reg, int bits)
   return reg & ((1 << bits) - 1);
 }
 
+// Release the predictor's tables so another one can be initialized
+//
+void free_predictor()
+{
+  if (arena)
+    munmap(arena, arenaSize);
+  arena = NULL;
+  arenaSize = 0;
+  layout_tables();
+  ghistoryReg = 0;
+}
+
+// A snapshot is the global history followed by the whole arena
+//
+size_t predictor_state_size()
+{
+  return sizeof ghistoryReg + arenaUsed;
+}
+
+int save_predictor(FILE *f)
+{
+  return fwrite(&ghistoryReg, sizeof ghistoryReg, 1, f) == 1 &&
+         fwrite(arena, 1, arenaUsed, f) == arenaUsed;
+}
+
+int load_predictor(FILE *f)
+{
+  return fread(&ghistoryReg, sizeof ghistoryReg, 1, f) == 1 &&
+         fread(arena, 1, arenaUsed, f) == arenaUsed;
+}
+
+// One lookup pass over every component; indices and predictions are kept
+// in compIndex/compPred for the matching train_hybrid call
+//
+uint8_t hybrid_prediction(uint32_t pc)
+{
+  uint32_t ghis = clip(ghistoryReg, ghistoryBits);
+
+  for (int c = 0; c < numComponents; c++)
+  {
+    switch (components[c])
+    {
+    case COMP_GSHARE:
+      compIndex[c] = clip(pc ^ ghistoryReg, ghistoryBits);
+      compPred[c] = counter_predict(gsharePredictor[compIndex[c]]);
+      break;
+    case COMP_GLOBAL:
+      compIndex[c] = ghis;
+      compPred[c] = counter_predict(globalPredictor[compIndex[c]]);
+      break;
+    case COMP_LOCAL:
+      compIndex[c] = lhistoryRegs[clip(pc, pcIndexBits)];
+      compPred[c] = counter_predict(localPredictor[compIndex[c]]);
+      break;
+    case COMP_PERCEPTRON:
+      compIndex[c] = hash(pc);
+      compPred[c] = forward(pc);
+      break;
+    }
+  }
+
+  if (hybridChooser == META)
+  {
+    // Follow the component with the highest confidence, earliest on ties
+    metaIndex = ghis * numComponents;
+    int best = 0;
+    for (int c = 1; c < numComponents; c++)
+      if (metaTable[metaIndex + c] > metaTable[metaIndex + best])
+        best = c;
+    return compPred[best];
+  }
+
+  metaIndex = ghis * (numComponents + 1);
+  voteOut = voteWeights[metaIndex];
+  for (int c = 0; c < numComponents; c++)
+    voteOut += compPred[c] == TAKEN ? voteWeights[metaIndex + c + 1]
+                                    : -voteWeights[metaIndex + c + 1];
+  return voteOut >= 0 ? TAKEN : NOTTAKEN;
+}
+
+void train_hybrid(uint32_t pc, uint8_t outcome)
+{
+  int8_t pout = outcome == TAKEN ? 1 : -1;
+
+  if (hybridChooser == META)
+  {
+    // As with the tournament choice table, only learn on disagreement
+    int agree = 1;
+    for (int c = 1; c < numComponents; c++)
+      agree &= compPred[c] == compPred[0];
+    if (!agree)
+      for (int c = 0; c < numComponents; c++)
+        counter_update(&metaTable[metaIndex + c], compPred[c] == outcome ? TAKEN : NOTTAKEN);
+  }
+  else if ((voteOut >= 0) != (outcome == TAKEN) ||
+           (voteOut < voteThreshold && voteOut > -voteThreshold))
+  {
+    backward(&voteWeights[metaIndex], pout);
+    for (int c = 0; c < numComponents; c++)
+      backward(&voteWeights[metaIndex + c + 1], compPred[c] == outcome);
+  }
+
+  for (int c = 0; c < numComponents; c++)
+  {
+    switch (components[c])
+    {
+    case COMP_GSHARE:
+      counter_update(&gsharePredictor[compIndex[c]], outcome);
+      break;
+    case COMP_GLOBAL:
+      counter_update(&globalPredictor[compIndex[c]], outcome);
+      break;
+    case COMP_LOCAL:
+      counter_update(&localPredictor[compIndex[c]], outcome);
+      lhistoryRegs[clip(pc, pcIndexBits)] = clip((compIndex[c] << 1) + outcome, lhistoryBits);
+      break;
+    case COMP_PERCEPTRON:
+      perceptron_train(compIndex[c], outcome);
+      break;
+    }
+  }
+
+  ghistoryReg = (ghistoryReg << 1) + outcome;
+}
+
 // Make a prediction for conditional branch instruction at PC 'pc'
 // Returning TAKEN indicates a prediction of taken; returning NOTTAKEN
 // indicates a prediction of not taken
@@ -146,11 +525,13 @@ make_prediction(uint32_t pc)
     return globalPredictor[clip(pc ^ ghistoryReg, ghistoryBits)] >= 2 ? TAKEN : NOTTAKEN;
   case TOURNAMENT:
     ghis = clip(ghistoryReg, ghistoryBits);
-    gpred = globalPredictor[ghis] >= 2 ? TAKEN : NOTTAKEN;
+    gpred = tournament[ghis].global >= 2 ? TAKEN : NOTTAKEN;
     lpred = localPredictor[lhistoryRegs[clip(pc, pcIndexBits)]] >= 2 ? TAKEN : NOTTAKEN;
-    return choice[ghis] <= 1 ? gpred : lpred;
+    return tournament[ghis].choice <= 1 ? gpred : lpred;
   case CUSTOM:
     return forward(pc);
+  case HYBRID:
+    return hybrid_prediction(pc);
   default:
     return NOTTAKEN;
   }
@@ -167,7 +548,6 @@ void train_predictor(uint32_t pc, uint8_t outcome)
   //
   int index = 0;
   int ghis = 0;
-  int8_t pout = outcome == TAKEN ? 1 : -1;
   switch (bpType)
   {
   case STATIC:
@@ -187,24 +567,24 @@ void train_predictor(uint32_t pc, uint8_t outcome)
     {
       if (outcome == lpred)
       {
-        if (choice[ghis] < 3)
-          choice[ghis] += 1;
+        if (tournament[ghis].choice < 3)
+          tournament[ghis].choice += 1;
       }
-      else if (choice[ghis] > 0)
-        choice[ghis] -= 1;
+      else if (tournament[ghis].choice > 0)
+        tournament[ghis].choice -= 1;
     }
 
     if (outcome == TAKEN)
     {
-      if (globalPredictor[ghis] < 3)
-        globalPredictor[ghis] += 1;
+      if (tournament[ghis].global < 3)
+        tournament[ghis].global += 1;
       if (localPredictor[lhistoryRegs[index]] < 3)
         localPredictor[lhistoryRegs[index]] += 1;
     }
     else
     {
-      if (globalPredictor[ghis] > 0)
-        globalPredictor[ghis] -= 1;
+      if (tournament[ghis].global > 0)
+        tournament[ghis].global -= 1;
       if (localPredictor[lhistoryRegs[index]] > 0)
         localPredictor[lhistoryRegs[index]] -= 1;
     }
@@ -213,18 +593,12 @@ void train_predictor(uint32_t pc, uint8_t outcome)
     lhistoryRegs[index] = clip((lhistoryRegs[index] << 1) + outcome, lhistoryBits);
     break;
   case CUSTOM:
-    index = hash(pc);
-
-    if ((_hot != outcome) || train)
-    {
-      backward(&(W[index][0]), pout);
-      for (int i = 1; i < W_H; i++)
-        backward(&(W[index][i]), (pout == ghistory[i - 1]));
-    }
-
-    for (int i = W_H - 1; i > 0; i--)
-      ghistory[i] = ghistory[i - 1];
-    ghistory[0] = pout;
+    perceptron_train(hash(pc), outcome);
+    ghistoryReg = (ghistoryReg << 1) + outcome;
+    break;
+  case HYBRID:
+    train_hybrid(pc, outcome);
+    break;
   default:
     break;
   }
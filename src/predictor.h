@@ -10,6 +10,7 @@
 #define PREDICTOR_H
 
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 
 //
@@ -30,8 +31,28 @@ extern const char *email;
 #define GSHARE      1
 #define TOURNAMENT  2
 #define CUSTOM      3
+#define HYBRID      4
 extern const char *bpName[];
 
+// Component predictors that can be composed by HYBRID
+#define COMP_GSHARE      0
+#define COMP_GLOBAL      1
+#define COMP_LOCAL       2
+#define COMP_PERCEPTRON  3
+#define NUM_COMP_TYPES   4
+extern const char *compName[];
+
+// Choosers used by HYBRID to combine its components
+#define META  0			// per-component confidence counters, pick the best
+#define VOTE  1			// perceptron-style weighted vote over components
+extern const char *chooserName[];
+
+// Optional schemes, set in predictorFeatures by implementations that
+// provide them
+#define HAS_HYBRID  1
+#define HAS_PERCEPTRON_SIZE 2	// CUSTOM is sized by wLen and wH
+extern const int predictorFeatures;
+
 // Definitions for 2-bit counters
 #define SN  0			// predict NT, strong not taken
 #define WN  1			// predict NT, weak not taken
@@ -45,6 +66,12 @@ extern int ghistoryBits; // Number of bits used for Global History
 extern int lhistoryBits; // Number of bits used for Local History
 extern int pcIndexBits;  // Number of bits used for PC index
 extern int bpType;       // Branch Prediction Type
+extern int wLen;         // Rows of perceptron weights
+extern int wH;           // Weights per perceptron row (bias + history)
+#define MAX_ROWS (1 << 24) // Most perceptron rows accepted
+extern int hybridChooser;                 // HYBRID chooser (META or VOTE)
+extern int numComponents;                 // Number of HYBRID components
+extern int components[NUM_COMP_TYPES];    // HYBRID component types, in order
 extern int verbose;
 
 //------------------------------------//
@@ -67,4 +94,32 @@ uint8_t make_prediction(uint32_t pc);
 //
 void train_predictor(uint32_t pc, uint8_t outcome);
 
+// Release the predictor's tables; init_predictor may then be called
+// again, possibly with a different configuration
+//
+void free_predictor();
+
+// Bytes written by save_predictor, 0 if snapshots are not supported
+//
+size_t predictor_state_size();
+
+// Write a snapshot of the predictor state to 'f', or restore one
+// taken with the same configuration
+//
+// Returns True if Successful
+//
+int save_predictor(FILE *f);
+int load_predictor(FILE *f);
+
+// Returns True if the configuration has per-PC local histories or
+// perceptron weights, i.e. whether lhistoryBits/pcIndexBits or wLen
+// size any table
+//
+int uses_local_history();
+int uses_perceptron();
+
+// Size of the predictor state in bits for the current configuration
+//
+uint64_t predictor_bits();
+
 #endif
@@ -0,0 +1,446 @@
+//========================================================//
+//  sample.c                                              //
+//  Source file for sampled simulation                    //
+//                                                        //
+//  SimPoint-style: every interval is summarized by a     //
+//  vector of how often each (hashed) branch PC occurs,   //
+//  the vectors are grouped with k-means, and the phases  //
+//  are treated as strata of a stratified sample. The     //
+//  profile is kept in a sidecar '<trace>.bbv' file       //
+//========================================================//
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "predictor.h"
+#include "trace.h"
+#include "sample.h"
+
+#define BBV_BITS 5                 // Branch PCs are hashed into 32 dimensions
+#define BBV_DIMS (1 << BBV_BITS)
+#define SAMPLES_PER_CLUSTER 2      // Intervals simulated per phase
+#define KMEANS_ITERATIONS 100
+#define FULL_PASS_COVERAGE 0.5     // Simulate everything past this fraction
+#define Z_95 1.96
+#define PROFILE_MAGIC "BPB1"
+
+typedef struct
+{
+  int64_t offset;        // Byte offset of the first branch
+  uint32_t branches;     // Branches in the interval (the last may be short)
+  int cluster;
+  int sampled;             // Chosen for simulation
+  uint32_t mispredictions; // Counted when simulated
+  float bbv[BBV_DIMS];   // Fraction of the interval's branches per PC hash
+} Interval;
+
+typedef struct
+{
+  char magic[4];
+  uint32_t interval;  // Branches per interval
+  int32_t clusters;   // Phases asked for
+  int32_t phases;     // Phases found
+  int32_t intervals;  // Number of intervals
+  uint64_t traceSize; // Size and modification time of the profiled trace,
+  int64_t traceTime;  // a profile of an older trace is ignored
+} ProfileHeader;
+
+Interval *intervals;
+int numIntervals;
+float (*centroids)[BBV_DIMS];
+
+float distance(const float *a, const float *b)
+{
+  float d = 0;
+  for (int i = 0; i < BBV_DIMS; i++)
+    d += (a[i] - b[i]) * (a[i] - b[i]);
+  return d;
+}
+
+// One pass over the trace recording where each interval starts and
+// its branch vector
+//
+void profile(uint32_t interval)
+{
+  int capacity = 64;
+  uint32_t pc;
+  uint8_t outcome;
+
+  intervals = malloc(capacity * sizeof *intervals);
+  numIntervals = 0;
+
+  for (;;)
+  {
+    // Only ask for offsets where intervals start, each one is a syscall
+    int start = tracePos % interval == 0;
+    int64_t offset = start ? trace_offset() : 0;
+    if (!read_branch(&pc, &outcome))
+      break;
+
+    if (start)
+    {
+      if (numIntervals == capacity)
+      {
+        capacity *= 2;
+        intervals = realloc(intervals, capacity * sizeof *intervals);
+      }
+      memset(&intervals[numIntervals], 0, sizeof *intervals);
+      intervals[numIntervals++].offset = offset;
+    }
+
+    Interval *cur = &intervals[numIntervals - 1];
+    cur->bbv[(pc * 2654435761u) >> (32 - BBV_BITS)] += 1;
+    cur->branches++;
+  }
+
+  for (int i = 0; i < numIntervals; i++)
+    for (int d = 0; d < BBV_DIMS; d++)
+      intervals[i].bbv[d] /= intervals[i].branches;
+}
+
+// k-means over the interval vectors, seeded with the first interval
+// and then repeatedly the one farthest from every centroid so far
+//
+int cluster(int k)
+{
+  if (k > numIntervals)
+    k = numIntervals;
+  centroids = malloc(k * sizeof *centroids);
+
+  memcpy(centroids[0], intervals[0].bbv, sizeof centroids[0]);
+  for (int c = 1; c < k; c++)
+  {
+    int far = 0;
+    float farthest = -1;
+    for (int i = 0; i < numIntervals; i++)
+    {
+      float nearest = INFINITY;
+      for (int j = 0; j < c; j++)
+        nearest = fminf(nearest, distance(intervals[i].bbv, centroids[j]));
+      if (nearest > farthest)
+      {
+        farthest = nearest;
+        far = i;
+      }
+    }
+    // Every interval is already a centroid, more would stay empty
+    if (farthest <= 0)
+    {
+      k = c;
+      break;
+    }
+    memcpy(centroids[c], intervals[far].bbv, sizeof centroids[c]);
+  }
+
+  for (int iter = 0, changed = 1; changed && iter < KMEANS_ITERATIONS; iter++)
+  {
+    changed = 0;
+    for (int i = 0; i < numIntervals; i++)
+    {
+      int best = 0;
+      for (int c = 1; c < k; c++)
+        if (distance(intervals[i].bbv, centroids[c]) < distance(intervals[i].bbv, centroids[best]))
+          best = c;
+      changed |= iter == 0 || intervals[i].cluster != best;
+      intervals[i].cluster = best;
+    }
+
+    for (int c = 0; c < k; c++)
+    {
+      int members = 0;
+      float sum[BBV_DIMS] = {0};
+      for (int i = 0; i < numIntervals; i++)
+      {
+        if (intervals[i].cluster != c)
+          continue;
+        members++;
+        for (int d = 0; d < BBV_DIMS; d++)
+          sum[d] += intervals[i].bbv[d];
+      }
+      for (int d = 0; members && d < BBV_DIMS; d++)
+        centroids[c][d] = sum[d] / members;
+    }
+  }
+
+  // Drop phases k-means left empty and renumber the rest
+  int phases = 0;
+  for (int c = 0; c < k; c++)
+  {
+    int members = 0;
+    for (int i = 0; i < numIntervals; i++)
+      if (intervals[i].cluster == c)
+      {
+        intervals[i].cluster = phases;
+        members++;
+      }
+    if (members)
+      memcpy(centroids[phases++], centroids[c], sizeof centroids[c]);
+  }
+
+  return phases;
+}
+
+// Read the intervals and phases of an earlier run from '<trace>.bbv'
+//
+// Returns the number of phases, 0 if there is no matching profile
+//
+int load_profile(uint32_t interval, int clusters)
+{
+  FILE *f = open_sidecar("bbv", "rb");
+  ProfileHeader header, current;
+
+  if (!f)
+    return 0;
+
+  stat_trace(&current.traceSize, &current.traceTime);
+  int valid = fread(&header, sizeof header, 1, f) == 1 &&
+              !memcmp(header.magic, PROFILE_MAGIC, 4) &&
+              header.interval == interval && header.clusters == clusters &&
+              header.phases > 0 && header.intervals > 0 &&
+              header.traceSize == current.traceSize &&
+              header.traceTime == current.traceTime;
+  if (valid)
+  {
+    numIntervals = header.intervals;
+    intervals = malloc(numIntervals * sizeof *intervals);
+    valid = fread(intervals, sizeof *intervals, numIntervals, f) == (size_t)numIntervals;
+    if (!valid)
+      free(intervals);
+  }
+  fclose(f);
+  return valid ? header.phases : 0;
+}
+
+// Keep the intervals and phases so later runs need not profile again
+//
+void save_profile(uint32_t interval, int clusters, int phases)
+{
+  FILE *f = open_sidecar("bbv", "wb");
+  ProfileHeader header = {PROFILE_MAGIC, interval, clusters, phases, numIntervals};
+
+  if (!f)
+    return;
+  stat_trace(&header.traceSize, &header.traceTime);
+  fwrite(&header, sizeof header, 1, f);
+  fwrite(intervals, sizeof *intervals, numIntervals, f);
+  fclose(f);
+}
+
+// Pick up to SAMPLES_PER_CLUSTER intervals of cluster 'c' uniformly at
+// random, so the spread of their rates estimates that of the phase
+//
+int choose_samples(int c, int *samples)
+{
+  int n = 0, seen = 0;
+
+  // Reservoir sampling with a fixed seed so runs are repeatable; a
+  // private seed leaves rand() alone for the predictor
+  unsigned seed = c + 1;
+  for (int i = 0; i < numIntervals; i++)
+  {
+    if (intervals[i].cluster != c)
+      continue;
+    seen++;
+    if (n < SAMPLES_PER_CLUSTER)
+      samples[n++] = i;
+    else if (rand_r(&seed) % seen < SAMPLES_PER_CLUSTER)
+      samples[rand_r(&seed) % SAMPLES_PER_CLUSTER] = i;
+  }
+
+  return n;
+}
+
+// Predict and train on interval 'j', counting its mispredictions
+//
+void run_interval(int j, uint64_t *simulated)
+{
+  uint32_t pc;
+  uint8_t outcome;
+
+  intervals[j].mispredictions = 0;
+  for (uint32_t b = 0; b < intervals[j].branches && read_branch(&pc, &outcome); b++)
+  {
+    if (make_prediction(pc) != outcome)
+      intervals[j].mispredictions++;
+    train_predictor(pc, outcome);
+  }
+  *simulated += intervals[j].branches;
+}
+
+// Simulate the sampled intervals in trace order. With snapshots of
+// this 'config' in the index, each sample starts from the exact state
+// a full run would have; otherwise from a fresh predictor trained on
+// the 'warmup' intervals before it. A predictor carries on from the
+// previous sample when their windows touch instead of replaying them;
+// when the windows cover most of the trace, everything is simulated
+// in one pass.
+//
+// Returns True if every interval was simulated
+//
+int simulate(int warmup, uint32_t interval, const char *config,
+             int snapshots, uint64_t *simulated)
+{
+  int covered = 0, last = -1, next = -1;
+
+  if (snapshots)
+    warmup = 0;
+  for (int i = 0; i < numIntervals; i++)
+  {
+    if (!intervals[i].sampled)
+      continue;
+    int first = i > warmup ? i - warmup : 0;
+    covered += i - (first > last ? first : last + 1) + 1;
+    last = i;
+  }
+
+  free_predictor();
+  init_predictor();
+  if (covered > FULL_PASS_COVERAGE * numIntervals)
+  {
+    seek_offset(intervals[0].offset, 0);
+    for (int j = 0; j < numIntervals; j++)
+      run_interval(j, simulated);
+    return 1;
+  }
+
+  for (int i = 0; i < numIntervals; i++)
+  {
+    if (!intervals[i].sampled)
+      continue;
+
+    int first = i > warmup ? i - warmup : 0;
+    if (next >= first)
+      first = next;
+    else if (snapshots)
+    {
+      // Restores the nearest snapshot and trains up to the interval
+      seek_offset(intervals[0].offset, 0);
+      *simulated += seek_branch((uint32_t)first * interval, 1, config);
+    }
+    else
+    {
+      free_predictor();
+      init_predictor();
+      seek_offset(intervals[first].offset, (uint32_t)first * interval);
+    }
+
+    for (int j = first; j <= i; j++)
+      run_interval(j, simulated);
+    next = i + 1;
+  }
+  return 0;
+}
+
+int sample_trace(uint32_t interval, int clusters, int warmup, const char *config)
+{
+  if (trace_offset() < 0 || interval == 0 || clusters < 1)
+    return 0;
+
+  int k = load_profile(interval, clusters);
+  if (k == 0)
+  {
+    profile(interval);
+    if (numIntervals == 0)
+      return 0;
+    k = cluster(clusters);
+    save_profile(interval, clusters, k);
+  }
+
+  // Stratified estimate: each phase is a stratum weighted by its share
+  // of the trace's branches
+  uint64_t total = 0, simulated = 0;
+  for (int i = 0; i < numIntervals; i++)
+    total += intervals[i].branches;
+
+  double rate = 0, variance = 0, pooled = 0;
+  int pooledPhases = 0, sampled = 0;
+  double *phaseWeight = calloc(k, sizeof *phaseWeight);
+  double *phaseVariance = calloc(k, sizeof *phaseVariance);
+  int *phaseSamples = calloc(k, sizeof *phaseSamples);
+  int *phaseMembers = calloc(k, sizeof *phaseMembers);
+  int samples[SAMPLES_PER_CLUSTER][k];
+
+  for (int i = 0; i < numIntervals; i++)
+  {
+    phaseWeight[intervals[i].cluster] += (double)intervals[i].branches / total;
+    phaseMembers[intervals[i].cluster]++;
+  }
+
+  for (int c = 0; c < k; c++)
+  {
+    int chosen[SAMPLES_PER_CLUSTER];
+    phaseSamples[c] = choose_samples(c, chosen);
+    for (int s = 0; s < phaseSamples[c]; s++)
+    {
+      samples[s][c] = chosen[s];
+      intervals[chosen[s]].sampled = 1;
+    }
+  }
+
+  // A full pass makes the rate exact
+  int snapshots = index_snapshots(config);
+  int exact = simulate(warmup, interval, config, snapshots, &simulated);
+  if (exact)
+  {
+    uint64_t mispredictions = 0;
+    for (int i = 0; i < numIntervals; i++)
+      mispredictions += intervals[i].mispredictions;
+    rate = (double)mispredictions / total;
+  }
+
+  for (int c = 0; !exact && c < k; c++)
+  {
+    int n = phaseSamples[c];
+    double r[SAMPLES_PER_CLUSTER], mean = 0;
+
+    for (int s = 0; s < n; s++)
+    {
+      Interval *sample = &intervals[samples[s][c]];
+      r[s] = (double)sample->mispredictions / sample->branches;
+      mean += r[s] / n;
+    }
+    for (int s = 0; s < n && n > 1; s++)
+      phaseVariance[c] += (r[s] - mean) * (r[s] - mean) / (n - 1);
+    if (n > 1)
+    {
+      pooled += phaseVariance[c];
+      pooledPhases++;
+    }
+
+    sampled += n;
+    rate += phaseWeight[c] * mean;
+  }
+
+  // Phases with one sample borrow the average spread of the others
+  for (int c = 0; !exact && c < k; c++)
+  {
+    double v = phaseSamples[c] > 1 || !pooledPhases ? phaseVariance[c] : pooled / pooledPhases;
+    double fpc = 1 - (double)phaseSamples[c] / phaseMembers[c];
+    variance += phaseWeight[c] * phaseWeight[c] * v / phaseSamples[c] * fpc;
+  }
+
+  printf("Storage (bits):  %10llu (%.3f Kbits)\n",
+         (unsigned long long)predictor_bits(), predictor_bits() / 1024.0);
+  printf("Branches:        %10llu\n", (unsigned long long)total);
+  printf("Simulated:       %10llu\n", (unsigned long long)simulated);
+  if (exact)
+    printf("Intervals:       %10d, all simulated\n", numIntervals);
+  else
+    printf("Intervals:       %10d of %d in %d phases\n", sampled, numIntervals, k);
+  // Without snapshots the warm-up biases the samples, so the spread
+  // of the estimate is not a confidence bound on the true rate
+  if (snapshots || exact)
+    printf("95%% Confidence:  +-%8.3f\n", 100 * Z_95 * sqrt(variance));
+  else
+    printf("Sample Spread:   +-%8.3f\n", 100 * Z_95 * sqrt(variance));
+  printf("Misprediction Rate: %7.3f\n", 100 * rate);
+
+  free(phaseWeight);
+  free(phaseVariance);
+  free(phaseSamples);
+  free(phaseMembers);
+  free(centroids);
+  free(intervals);
+  return 1;
+}
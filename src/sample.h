@@ -0,0 +1,28 @@
+//========================================================//
+//  sample.h                                              //
+//  Header file for sampled simulation                    //
+//                                                        //
+//  Profiles a trace into fixed-size intervals, clusters  //
+//  them into phases and simulates only a few intervals   //
+//  of each phase                                         //
+//========================================================//
+
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#include <stdint.h>
+
+// Simulate the configured predictor on a sample of the open trace and
+// print the extrapolated statistics. The trace is cut into intervals
+// of 'interval' branches grouped into at most 'clusters' phases, and
+// the profile is reused by later runs with the same shape. Samples are
+// simulated in trace order, a predictor carrying on into the next
+// sample when their windows touch. Each sample starts from the index
+// snapshot of 'config' if there is one, otherwise from a fresh
+// predictor trained on the 'warmup' intervals before it.
+//
+// Returns True if Successful
+//
+int sample_trace(uint32_t interval, int clusters, int warmup, const char *config);
+
+#endif
@@ -0,0 +1,269 @@
+//========================================================//
+//  trace.c                                               //
+//  Source file for reading branch traces                 //
+//                                                        //
+//  The index of a trace is a sidecar '<trace>.idx' file: //
+//  a header followed by one entry per 'interval'         //
+//  branches, each optionally followed by a snapshot of   //
+//  the predictor state                                   //
+//========================================================//
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "predictor.h"
+#include "trace.h"
+
+#define INDEX_MAGIC "BPI2"
+
+typedef struct
+{
+  char magic[4];
+  uint32_t interval;  // Branches between entries
+  uint32_t entries;   // Number of entries
+  uint32_t stateSize; // Bytes of predictor snapshot per entry, 0 for none
+  char config[128];   // Configuration the snapshots were taken with
+  uint64_t traceSize; // Size and modification time of the indexed trace,
+  int64_t traceTime;  // an index of an older trace is ignored
+} IndexHeader;
+
+typedef struct
+{
+  uint64_t branch; // Branch number
+  uint64_t offset; // Byte offset of the branch in the trace
+} IndexEntry;
+
+FILE *stream;
+const char *traceName;
+uint32_t tracePos;
+
+char *buf = NULL;
+size_t len = 0;
+
+FILE *indexFile;    // Index being written, NULL if none
+IndexHeader indexHeader;
+
+int open_trace(const char *name)
+{
+  traceName = name;
+  tracePos = 0;
+  stream = name ? fopen(name, "r") : stdin;
+  return stream != NULL;
+}
+
+void stat_trace(uint64_t *size, int64_t *time)
+{
+  struct stat st;
+  *size = 0;
+  *time = 0;
+  if (traceName && stat(traceName, &st) == 0)
+  {
+    *size = st.st_size;
+    *time = st.st_mtime;
+  }
+}
+
+FILE *open_sidecar(const char *ext, const char *mode)
+{
+  if (!traceName)
+    return NULL;
+
+  char *name = malloc(strlen(traceName) + strlen(ext) + 2);
+  sprintf(name, "%s.%s", traceName, ext);
+  FILE *f = fopen(name, mode);
+  free(name);
+  return f;
+}
+
+// Read the header of the index 'f', rejecting an index of another trace
+//
+// Returns True if the index is usable
+//
+int read_index_header(FILE *f, IndexHeader *header)
+{
+  uint64_t size;
+  int64_t time;
+
+  if (fread(header, sizeof *header, 1, f) != 1 ||
+      memcmp(header->magic, INDEX_MAGIC, 4) ||
+      header->interval == 0 || header->entries == 0)
+    return 0;
+
+  // The trace was rewritten since it was indexed
+  stat_trace(&size, &time);
+  if (header->traceSize != size || header->traceTime != time)
+  {
+    fprintf(stderr, "Ignoring %s.idx, it does not match the trace\n", traceName);
+    return 0;
+  }
+  return 1;
+}
+
+// Whether the index header holds snapshots of this very predictor
+//
+int has_snapshots(const IndexHeader *header, const char *config)
+{
+  return header->stateSize > 0 &&
+         header->stateSize == predictor_state_size() &&
+         !strncmp(header->config, config, sizeof header->config);
+}
+
+// Append the entry for the next branch when one is due
+//
+void index_branch()
+{
+  if (tracePos % indexHeader.interval != 0)
+    return;
+
+  IndexEntry entry = {tracePos, ftello(stream)};
+  fwrite(&entry, sizeof entry, 1, indexFile);
+  if (indexHeader.stateSize)
+    save_predictor(indexFile);
+  indexHeader.entries++;
+}
+
+int read_branch(uint32_t *pc, uint8_t *outcome)
+{
+  if (indexFile)
+    index_branch();
+
+  if (getline(&buf, &len, stream) == -1)
+    return 0;
+
+  // Lines are "0x<pc> <outcome>"; strtoul is much cheaper than sscanf
+  char *end;
+  *pc = strtoul(buf, &end, 16);
+  *outcome = strtoul(end, NULL, 10);
+  tracePos++;
+
+  return 1;
+}
+
+void close_trace()
+{
+  end_index();
+  fclose(stream);
+  free(buf);
+  buf = NULL;
+  len = 0;
+}
+
+int64_t trace_offset()
+{
+  return ftello(stream);
+}
+
+void seek_offset(int64_t offset, uint32_t branch)
+{
+  fseeko(stream, offset, SEEK_SET);
+  tracePos = branch;
+}
+
+int begin_index(uint32_t interval, int snapshots, const char *config)
+{
+  // Entries hold offsets, so the trace must be a seekable file
+  if (interval == 0 || !traceName || trace_offset() < 0)
+    return 0;
+
+  indexFile = open_sidecar("idx", "wb");
+  if (!indexFile)
+    return 0;
+
+  memset(&indexHeader, 0, sizeof indexHeader);
+  memcpy(indexHeader.magic, INDEX_MAGIC, 4);
+  indexHeader.interval = interval;
+  indexHeader.stateSize = snapshots ? predictor_state_size() : 0;
+  strncpy(indexHeader.config, config, sizeof indexHeader.config - 1);
+  stat_trace(&indexHeader.traceSize, &indexHeader.traceTime);
+
+  fwrite(&indexHeader, sizeof indexHeader, 1, indexFile);
+  return 1;
+}
+
+void end_index()
+{
+  if (!indexFile)
+    return;
+
+  // The entry count is only known now
+  rewind(indexFile);
+  fwrite(&indexHeader, sizeof indexHeader, 1, indexFile);
+  fclose(indexFile);
+  indexFile = NULL;
+}
+
+// Position the trace (and with 'warm' the predictor) at the last index
+// entry at or before 'target'
+//
+void seek_index(uint32_t target, int warm, const char *config)
+{
+  FILE *f = open_sidecar("idx", "rb");
+  IndexHeader header;
+  IndexEntry entry;
+
+  if (!f)
+    return;
+
+  if (read_index_header(f, &header))
+  {
+    uint32_t k = target / header.interval;
+    if (k >= header.entries)
+      k = header.entries - 1;
+
+    // A warm start needs a snapshot of this very predictor
+    if (!warm || has_snapshots(&header, config))
+    {
+      fseeko(f, sizeof header + (off_t)k * (sizeof entry + header.stateSize), SEEK_SET);
+      if (fread(&entry, sizeof entry, 1, f) != 1 ||
+          (warm && !load_predictor(f)) ||
+          fseeko(stream, entry.offset, SEEK_SET) != 0)
+      {
+        fprintf(stderr, "Corrupt index for %s\n", traceName);
+        exit(1);
+      }
+      tracePos = entry.branch;
+    }
+  }
+  fclose(f);
+}
+
+int index_snapshots(const char *config)
+{
+  FILE *f = open_sidecar("idx", "rb");
+  IndexHeader header;
+
+  if (!f)
+    return 0;
+  int usable = read_index_header(f, &header) && has_snapshots(&header, config);
+  fclose(f);
+  return usable;
+}
+
+uint32_t seek_branch(uint32_t target, int warm, const char *config)
+{
+  uint32_t pc;
+  uint8_t outcome;
+
+  if (trace_offset() >= 0)
+    seek_index(target, warm, config);
+  uint32_t from = tracePos;
+
+  while (tracePos < target)
+  {
+    if (warm)
+    {
+      if (!read_branch(&pc, &outcome))
+        break;
+      make_prediction(pc);
+      train_predictor(pc, outcome);
+    }
+    else
+    {
+      if (getline(&buf, &len, stream) == -1)
+        break;
+      tracePos++;
+    }
+  }
+  return tracePos - from;
+}
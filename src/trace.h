@@ -0,0 +1,75 @@
+//========================================================//
+//  trace.h                                               //
+//  Header file for reading branch traces                 //
+//                                                        //
+//  Includes the trace reader and the sidecar trace index //
+//  used to seek to a branch without replaying the trace  //
+//========================================================//
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+extern FILE *stream;       // Trace being read
+extern const char *traceName; // Trace file name, NULL for stdin
+extern uint32_t tracePos;  // Number of the next branch in the trace
+
+// Open the trace file 'name', or stdin if 'name' is NULL
+//
+// Returns True if Successful
+//
+int open_trace(const char *name);
+
+// Reads a line from the input stream and extracts the
+// PC and Outcome of a branch
+//
+// Returns True if Successful
+//
+int read_branch(uint32_t *pc, uint8_t *outcome);
+
+void close_trace();
+
+// Byte offset of the next branch, -1 if the trace is not seekable
+//
+int64_t trace_offset();
+
+// Continue reading at byte 'offset', the start of branch 'branch'
+//
+void seek_offset(int64_t offset, uint32_t branch);
+
+// Size and modification time of the trace file, 0 if unknown
+//
+void stat_trace(uint64_t *size, int64_t *time);
+
+// Open the sidecar file '<trace>.<ext>' with 'mode', NULL for stdin
+//
+FILE *open_sidecar(const char *ext, const char *mode);
+
+// Start writing '<trace>.idx' while the trace is read: an entry every
+// 'interval' branches with the offset of the branch and, if
+// 'snapshots', the predictor state before it. Snapshots are only
+// restored for the same 'config'.
+//
+// Returns True if Successful
+//
+int begin_index(uint32_t interval, int snapshots, const char *config);
+void end_index();
+
+// Move the trace to branch 'target'. The nearest index entry, if the
+// trace has an index, is used to seek. With 'warm' the predictor is
+// trained on every branch before 'target', starting from the nearest
+// snapshot taken with 'config' when there is one; otherwise the
+// skipped branches are not simulated at all.
+//
+// Returns the number of branches read to reach 'target'
+//
+uint32_t seek_branch(uint32_t target, int warm, const char *config);
+
+// Whether the index has snapshots taken with 'config', so that
+// seek_branch() can restore the predictor state exactly
+//
+int index_snapshots(const char *config);
+
+#endif